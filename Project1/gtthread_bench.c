@@ -0,0 +1,822 @@
+#define _POSIX_C_SOURCE 200809L        /* for clock_gettime()              */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "gtthread.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+/*
+ * micro-benchmarks for the gtthread package.  Uses the same -n/-t/-c/-p
+ * knobs as gtthread_test_mutex, but doesn't print anything while the
+ * threads are running.  Each benchmark collects per-operation samples
+ * (nanoseconds unless the unit column says otherwise) and reports
+ * min/p50/p99/max so that scheduler changes can be compared run to run.
+ */
+#define PERIOD_USEC     1000            /* period passed to gtthread_init   */
+#define MUTEX_BATCH     1000            /* lock/unlock pairs per sample     */
+#define SELF_BATCH      1000            /* self/id lookups per sample       */
+#define FAIR_BATCH      10              /* acquisitions between held yields */
+
+int  loops = 1000;
+int  preemptive = FALSE;
+int  json = FALSE;
+int  results = 0;
+
+/*
+ * the benchmarks that can be picked with -b, and the comma separated list
+ * that was picked (NULL runs them all)
+ */
+char *bench_names[] =
+{
+    "yield",
+    "create_join",
+    "mutex_uncontended",
+    "self_id",
+    "mutex_contended",
+    "mutex_fairness",
+    "preempt_jitter",
+    NULL
+};
+char *bench_list = NULL;
+
+/*
+ * timestamp of the most recent gtthread_yield() call, used to measure the
+ * time until the next thread is running.  Anything else that gets switched
+ * to (a new thread, main) sets it to 0 so that the following sample, which
+ * would span more than one switch, is skipped.
+ */
+volatile long long  yield_start;
+
+/*
+ * set once the idle threads used by the self/id benchmark should exit
+ */
+volatile int        idlers_done;
+
+/*
+ * the number of times each mutex is taken in the fairness benchmark
+ */
+int                 fair_target;
+
+struct benchdata
+{
+    gtthread_mutex_t      mp;
+    int                   ctr;
+    long long             race_start;   /* first acquisition (fairness)     */
+    long long             race_end;     /* last acquisition (fairness)      */
+    long long           * waits;        /* wait for each acquisition        */
+};
+
+struct threaddata
+{
+    struct benchdata    * data;
+    long long           * samples;
+    int                   nsamples;
+    volatile int          done;
+};
+
+static long long now_nsec(void)
+{
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long) ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/*
+ * returns TRUE if the list entry starting at p (ended by a comma or the end
+ * of the string) is name
+ */
+static int token_is(char *p, char *name)
+{
+    size_t      len = strlen(name);
+
+    return (strncmp(p, name, len) == 0) && ((p[len] == ',') || (p[len] == '\0'));
+}
+
+/*
+ * returns TRUE if name appears in the comma separated list
+ */
+static int in_list(char *list, char *name)
+{
+    char      * p = list;
+
+    while( p != NULL )
+    {
+        if( token_is(p, name) )
+        {
+            return TRUE;
+        }
+        p = strchr(p, ',');
+        if( p != NULL )
+        {
+            p++;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * returns TRUE if the named benchmark should be run
+ */
+static int selected(char *name)
+{
+    return (bench_list == NULL) || in_list(bench_list, name);
+}
+
+static int cmp_sample(const void *a, const void *b)
+{
+    long long   x = *(const long long *) a;
+    long long   y = *(const long long *) b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+/*
+ * sorts the samples and prints one result line in the selected format
+ */
+static void report(char *name, char *unit, long long *samples, int cnt)
+{
+    long long       min = 0;
+    long long       p50 = 0;
+    long long       p99 = 0;
+    long long       max = 0;
+    double          mean = 0.0;
+    int             i;
+
+    if( cnt > 0 )
+    {
+        qsort(samples, cnt, sizeof(*samples), cmp_sample);
+        for(i=0; i < cnt; i++)
+        {
+            mean += samples[i];
+        }
+        mean /= cnt;
+        min = samples[0];
+        p50 = samples[(cnt - 1) / 2];
+        p99 = samples[((long) (cnt - 1) * 99) / 100];
+        max = samples[cnt - 1];
+    }
+
+    if( json )
+    {
+        fprintf(stdout, "%s\n  { \"benchmark\": \"%s\", \"unit\": \"%s\", \"count\": %d, "
+                "\"min\": %lld, \"p50\": %lld, \"p99\": %lld, \"max\": %lld, "
+                "\"mean\": %.1f }", (results > 0) ? "," : "[", name, unit, cnt,
+                min, p50, p99, max, mean);
+    }
+    else
+    {
+        if( results == 0 )
+        {
+            fprintf(stdout, "benchmark,unit,count,min,p50,p99,max,mean\n");
+        }
+        fprintf(stdout, "%s,%s,%d,%lld,%lld,%lld,%lld,%.1f\n", name, unit, cnt,
+                min, p50, p99, max, mean);
+    }
+    fflush(stdout);
+    results++;
+}
+
+static void spin(int cnt)
+{
+    volatile int    j = 0;
+    int             k;
+
+    for(k=0; k < cnt; k++)
+    {
+        j++;
+    }
+}
+
+/*
+ * yield-to-yield latency:  the time from one thread calling gtthread_yield()
+ * until the next thread returns from its own gtthread_yield()
+ */
+void *yielder(void *pArg)
+{
+    struct threaddata   * td = (struct threaddata *) pArg;
+    long long             start;
+    long long             end;
+    int                   i;
+
+    yield_start = 0;
+    for(i=0; i < loops; i++)
+    {
+        yield_start = now_nsec();
+        gtthread_yield();
+        end = now_nsec();
+        start = yield_start;
+        if( start != 0 )
+        {
+            td->samples[td->nsamples++] = end - start;
+        }
+    }
+    td->done = TRUE;
+
+    return NULL;
+}
+
+void *noop(void *pArg)
+{
+    return pArg;
+}
+
+/*
+ * just stays alive (yielding) so that lookups have a populated thread table
+ */
+void *idler(void *pArg)
+{
+    while( ! idlers_done )
+    {
+        gtthread_yield();
+    }
+
+    return pArg;
+}
+
+/*
+ * contended lock:  the time each thread waits to get the lock.  In
+ * cooperative mode the holder yields while holding the lock so the other
+ * threads actually find it held.
+ */
+void *contender(void *pArg)
+{
+    struct threaddata   * td = (struct threaddata *) pArg;
+    long long             start;
+    int                   rtn;
+    int                   i;
+
+    for(i=0; i < loops; i++)
+    {
+        start = now_nsec();
+        rtn = gtthread_mutex_lock(&td->data->mp);
+        assert(rtn != -1);
+        td->samples[td->nsamples++] = now_nsec() - start;
+
+        td->data->ctr++;
+        if( ! preemptive )
+        {
+            gtthread_yield();
+        }
+        else
+        {
+            spin(1000);
+        }
+
+        rtn = gtthread_mutex_unlock(&td->data->mp);
+        assert(rtn != -1);
+
+        if( ! preemptive )
+        {
+            gtthread_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * lock fairness:  the threads sharing a mutex race until it has been taken
+ * fair_target times, each counting how many of those it got.  A thread goes
+ * straight back to gtthread_mutex_lock() after unlocking, so a barging lock
+ * lets it re-take the lock while a handoff lock passes it to a waiter.  In
+ * cooperative mode the holder yields with the lock held every FAIR_BATCH
+ * acquisitions so that the others get to queue up as waiters; under -p
+ * pre-emption does that.  Either way a barging lock shows up as skewed
+ * counts.  The wait for each acquisition is stored in the mutex's waits
+ * slot for that acquisition, which is safe as it's written under the lock.
+ */
+void *barger(void *pArg)
+{
+    struct threaddata   * td = (struct threaddata *) pArg;
+    long long             acquired = 0;
+    long long             start;
+    long long             now;
+    int                   rtn;
+
+    while( TRUE )
+    {
+        start = now_nsec();
+        rtn = gtthread_mutex_lock(&td->data->mp);
+        assert(rtn != -1);
+        now = now_nsec();
+        if( td->data->ctr >= fair_target )
+        {
+            rtn = gtthread_mutex_unlock(&td->data->mp);
+            assert(rtn != -1);
+            break;
+        }
+        td->data->waits[td->data->ctr] = now - start;
+        if( td->data->ctr == 0 )
+        {
+            td->data->race_start = now;
+        }
+        td->data->ctr++;
+        acquired++;
+        if( td->data->ctr == fair_target )
+        {
+            td->data->race_end = now_nsec();
+        }
+
+        if( (! preemptive) && ((acquired % FAIR_BATCH) == 0) )
+        {
+            gtthread_yield();
+        }
+
+        rtn = gtthread_mutex_unlock(&td->data->mp);
+        assert(rtn != -1);
+    }
+    td->samples[td->nsamples++] = acquired;
+
+    return NULL;
+}
+
+/*
+ * preemption jitter:  busy loop reading the clock.  A gap between two reads
+ * of more than half a period means this thread was switched out, and the
+ * time since the previous gap is the length of the quantum it got.  The
+ * sample is how far that quantum was from the requested period.
+ */
+void *spinner(void *pArg)
+{
+    struct threaddata   * td = (struct threaddata *) pArg;
+    long long             period = PERIOD_USEC * 1000LL;
+    long long             deadline;
+    long long             slice_start = 0;
+    long long             last;
+    long long             now;
+    long long             diff;
+
+    last = now_nsec();
+    deadline = last + (period * loops * 10);
+    while( (td->nsamples < loops) && (last < deadline) )
+    {
+        now = now_nsec();
+        if( (now - last) > (period / 2) )
+        {
+            /*
+             * the first slice is partial, so only count whole ones
+             */
+            if( slice_start != 0 )
+            {
+                diff = (last - slice_start) - period;
+                td->samples[td->nsamples++] = (diff < 0) ? -diff : diff;
+            }
+            slice_start = now;
+        }
+        last = now;
+    }
+
+    return NULL;
+}
+
+/*
+ * compacts the per-thread samples into the front of samples so they can be
+ * sorted and reported together
+ */
+static void gather_report(char *name, char *unit, struct threaddata *tds,
+                          int nthreads, long long *samples)
+{
+    int                     cnt = 0;
+    int                     i;
+
+    for(i=0; i < nthreads; i++)
+    {
+        memmove(&samples[cnt], tds[i].samples, tds[i].nsamples * sizeof(*samples));
+        cnt += tds[i].nsamples;
+    }
+    report(name, unit, samples, cnt);
+}
+
+/*
+ * runs func in nthreads threads, joins them all and then gathers their
+ * samples into one array
+ */
+static void run_threads(char *name, char *unit, void *(*func)(void *), int nthreads,
+                        struct benchdata *datas, int ndatas, int per_thread)
+{
+    struct threaddata     * tds;
+    gtthread_t            * threads;
+    long long             * samples;
+    int                     i;
+    int                     rtn;
+
+    tds = calloc(nthreads, sizeof(*tds));
+    threads = calloc(nthreads, sizeof(*threads));
+    samples = calloc((size_t) nthreads * per_thread, sizeof(*samples));
+    assert((tds != NULL) && (threads != NULL) && (samples != NULL));
+
+    for(i=0; i < nthreads; i++)
+    {
+        tds[i].data = (datas != NULL) ? &datas[i % ndatas] : NULL;
+        tds[i].samples = &samples[(size_t) i * per_thread];
+        rtn = gtthread_create(&threads[i], func, &tds[i]);
+        assert(rtn != -1);
+    }
+
+    for(i=0; i < nthreads; i++)
+    {
+        rtn = gtthread_join(threads[i], NULL);
+        assert(rtn != -1);
+    }
+
+    gather_report(name, unit, tds, nthreads, samples);
+
+    free(samples);
+    free(threads);
+    free(tds);
+}
+
+/*
+ * the yield benchmark, run like run_threads() except that main waits for the
+ * yielders by yielding itself (clearing yield_start each time) rather than in
+ * gtthread_join, so switches through main are never counted
+ */
+static void bench_yield(int nthreads)
+{
+    struct threaddata     * tds;
+    gtthread_t            * threads;
+    long long             * samples;
+    int                     running;
+    int                     i;
+    int                     rtn;
+
+    tds = calloc(nthreads, sizeof(*tds));
+    threads = calloc(nthreads, sizeof(*threads));
+    samples = calloc((size_t) nthreads * loops, sizeof(*samples));
+    assert((tds != NULL) && (threads != NULL) && (samples != NULL));
+
+    for(i=0; i < nthreads; i++)
+    {
+        tds[i].samples = &samples[(size_t) i * loops];
+        rtn = gtthread_create(&threads[i], yielder, &tds[i]);
+        assert(rtn != -1);
+    }
+
+    do
+    {
+        yield_start = 0;
+        gtthread_yield();
+
+        running = 0;
+        for(i=0; i < nthreads; i++)
+        {
+            if( ! tds[i].done )
+            {
+                running++;
+            }
+        }
+    } while( running > 0 );
+
+    for(i=0; i < nthreads; i++)
+    {
+        rtn = gtthread_join(threads[i], NULL);
+        assert(rtn != -1);
+    }
+
+    gather_report("yield", "ns", tds, nthreads, samples);
+
+    free(samples);
+    free(threads);
+    free(tds);
+}
+
+static void bench_create_join(int nthreads)
+{
+    gtthread_t            * threads;
+    long long             * samples;
+    long long               start;
+    int                     i;
+    int                     j;
+    int                     rtn;
+
+    threads = calloc(nthreads, sizeof(*threads));
+    samples = calloc(loops, sizeof(*samples));
+    assert((threads != NULL) && (samples != NULL));
+
+    for(j=0; j < loops; j++)
+    {
+        start = now_nsec();
+        for(i=0; i < nthreads; i++)
+        {
+            rtn = gtthread_create(&threads[i], noop, NULL);
+            assert(rtn != -1);
+        }
+        for(i=0; i < nthreads; i++)
+        {
+            rtn = gtthread_join(threads[i], NULL);
+            assert(rtn != -1);
+        }
+        samples[j] = (now_nsec() - start) / nthreads;
+    }
+    report("create_join", "ns", samples, loops);
+
+    free(samples);
+    free(threads);
+}
+
+static void bench_mutex_uncontended(void)
+{
+    gtthread_mutex_t        mp;
+    long long             * samples;
+    long long               start;
+    int                     errors = 0;
+    int                     i;
+    int                     j;
+
+    samples = calloc(loops, sizeof(*samples));
+    assert(samples != NULL);
+    gtthread_mutex_init(&mp);
+
+    for(j=0; j < loops; j++)
+    {
+        /*
+         * only count failures inside the timed batch, assert afterwards
+         */
+        start = now_nsec();
+        for(i=0; i < MUTEX_BATCH; i++)
+        {
+            errors += (gtthread_mutex_lock(&mp) == -1);
+            errors += (gtthread_mutex_unlock(&mp) == -1);
+        }
+        samples[j] = (now_nsec() - start) / MUTEX_BATCH;
+        assert(errors == 0);
+    }
+    report("mutex_uncontended", "ns", samples, loops);
+
+    free(samples);
+}
+
+/*
+ * cost of gtthread_id(gtthread_self()) while nthreads other threads exist,
+ * so that lookups which scale with the number of threads show up
+ */
+static void bench_self_id(int nthreads)
+{
+    gtthread_t            * threads;
+    long long             * samples;
+    long long               start;
+    volatile int            id;
+    int                     i;
+    int                     j;
+    int                     rtn;
+
+    threads = calloc(nthreads, sizeof(*threads));
+    samples = calloc(loops, sizeof(*samples));
+    assert((threads != NULL) && (samples != NULL));
+
+    idlers_done = FALSE;
+    for(i=0; i < nthreads; i++)
+    {
+        rtn = gtthread_create(&threads[i], idler, NULL);
+        assert(rtn != -1);
+    }
+
+    for(j=0; j < loops; j++)
+    {
+        start = now_nsec();
+        for(i=0; i < SELF_BATCH; i++)
+        {
+            id = gtthread_id(gtthread_self());
+        }
+        samples[j] = (now_nsec() - start) / SELF_BATCH;
+    }
+    (void) id;
+    report("self_id", "ns", samples, loops);
+
+    idlers_done = TRUE;
+    for(i=0; i < nthreads; i++)
+    {
+        rtn = gtthread_join(threads[i], NULL);
+        assert(rtn != -1);
+    }
+
+    free(samples);
+    free(threads);
+}
+
+/*
+ * reports the per-thread acquisition counts for the fairness run, the wait
+ * for every acquisition, and the average cost of an acquisition (i.e. the
+ * lock's throughput) for each mutex.  The cost is timed from the first to the last acquisition only, so
+ * it covers the switches the lock policy causes (plus the held yields every
+ * FAIR_BATCH acquisitions in cooperative mode) but no setup or reporting.
+ */
+static void bench_mutex_fairness(int counters, int threads_per)
+{
+    struct benchdata        * datas;
+    long long               * costs;
+    long long               * waits;
+    int                       i;
+
+    fair_target = loops * threads_per;
+    datas = calloc(counters, sizeof(*datas));
+    costs = calloc(counters, sizeof(*costs));
+    waits = calloc((size_t) counters * fair_target, sizeof(*waits));
+    assert((datas != NULL) && (costs != NULL) && (waits != NULL));
+    for(i=0; i < counters; i++)
+    {
+        gtthread_mutex_init(&datas[i].mp);
+        datas[i].waits = &waits[(size_t) i * fair_target];
+    }
+
+    run_threads("mutex_acq_skew", "acq", barger, counters*threads_per, datas, counters, 1);
+    report("mutex_acq_latency", "ns", waits, counters * fair_target);
+    for(i=0; i < counters; i++)
+    {
+        costs[i] = (datas[i].race_end - datas[i].race_start) / fair_target;
+    }
+    report("mutex_acq_cost", "ns", costs, counters);
+
+    free(waits);
+    free(costs);
+    free(datas);
+}
+
+int
+main(int argc, char **argv)
+{
+    int                       counters = 1;
+    int                       cnt;
+    int                       i;
+    struct benchdata        * datas;
+    int                       opt;
+    extern int                optind;
+    extern char             * optarg;
+    int                       threads_per = 5;
+    int                       failed = FALSE;
+    char                    * name;
+    int                       known;
+
+    while( (opt=getopt(argc,argv, "hjpb:n:c:t:")) != -1 )
+    {
+        switch(opt)
+        {
+            case 'b':                   /* benchmarks to run                */
+                bench_list = optarg;
+                for(name=bench_list; name != NULL; )
+                {
+                    known = FALSE;
+                    for(i=0; bench_names[i] != NULL; i++)
+                    {
+                        if( token_is(name, bench_names[i]) )
+                        {
+                            known = TRUE;
+                        }
+                    }
+                    if( ! known )
+                    {
+                        fprintf(stderr, "unknown benchmark in %s\n", name);
+                        exit(10);
+                    }
+                    name = strchr(name, ',');
+                    if( name != NULL )
+                    {
+                        name++;
+                    }
+                }
+                break;
+
+            case 'j':
+                json = TRUE;
+                break;
+
+            case 'p':
+                preemptive = TRUE;
+                break;
+
+            case 'n':                   /* number of counters               */
+                cnt = atoi(optarg);
+                if( cnt < 1 )
+                {
+                    fprintf(stderr, "number of counters of %s too low, using %d\n",
+                            optarg, counters);
+                }
+                else
+                {
+                    counters = cnt;
+                }
+                break;
+
+            case 'c':                   /* number of iterations to run      */
+                cnt = atoi(optarg);
+                if( cnt < 1 )
+                {
+                    fprintf(stderr, "iterations of %s too low, using %d\n", optarg, loops);
+                }
+                else
+                {
+                    loops = cnt;
+                }
+                break;
+
+            case 't':                   /* number of threads per counter    */
+                cnt = atoi(optarg);
+                if( cnt < 1 )
+                {
+                    fprintf(stderr, "threads per of %s too low, using %d\n", optarg, threads_per);
+                }
+                else
+                {
+                    threads_per = cnt;
+                }
+                break;
+
+            default:
+                fprintf(stderr, "Unknown options: %s\n", optarg);
+                /* fall through */
+
+            case 'h':
+                fprintf(stderr, "Usage:  bench [-j] [-p] [-b list] [-n #] [-c #] [-t #]\n");
+                fprintf(stderr, "        -j - report results as JSON (vs CSV)\n");
+                fprintf(stderr, "        -b list - comma separated benchmarks to run (default: all)\n");
+                for(i=0; bench_names[i] != NULL; i++)
+                {
+                    fprintf(stderr, "             %s\n", bench_names[i]);
+                }
+                fprintf(stderr, "        -p - use pre-emptive switching (vs yielding)\n");
+                fprintf(stderr, "        -n # - the # of contended mutexes (default: 1)\n");
+                fprintf(stderr, "        -c # - the # of iterations to run (default: 1000)\n");
+                fprintf(stderr, "        -t # - the # of threads per mutex (default: 5)\n");
+                exit(10);
+                break;
+        }
+    }
+
+    /*
+     * initialize the threads subsystem
+     */
+    gtthread_init(PERIOD_USEC);
+
+    if( selected("yield") )
+    {
+        bench_yield(threads_per);
+    }
+
+    if( selected("create_join") )
+    {
+        bench_create_join(threads_per);
+    }
+
+    if( selected("mutex_uncontended") )
+    {
+        bench_mutex_uncontended();
+    }
+
+    if( selected("self_id") )
+    {
+        bench_self_id(counters*threads_per);
+    }
+
+    if( selected("mutex_contended") )
+    {
+        datas = calloc(counters, sizeof(*datas));
+        assert(datas != NULL);
+        for(i=0; i < counters; i++)
+        {
+            gtthread_mutex_init(&datas[i].mp);
+        }
+        run_threads("mutex_contended", "ns", contender, counters*threads_per, datas, counters, loops);
+        for(i=0; i < counters; i++)
+        {
+            if( datas[i].ctr != (loops * threads_per) )
+            {
+                fprintf(stderr, "count[%d] = %d, expected %d\n", i, datas[i].ctr,
+                        loops * threads_per);
+                failed = TRUE;
+            }
+        }
+        free(datas);
+    }
+
+    if( selected("mutex_fairness") )
+    {
+        bench_mutex_fairness(counters, threads_per);
+    }
+
+    /*
+     * without pre-emption the spinners would never be switched out
+     */
+    if( preemptive && selected("preempt_jitter") )
+    {
+        run_threads("preempt_jitter", "ns", spinner, threads_per, NULL, 0, loops);
+    }
+
+    if( json )
+    {
+        fprintf(stdout, "%s\n]\n", (results == 0) ? "[" : "");
+    }
+
+    return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
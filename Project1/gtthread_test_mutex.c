@@ -1,7 +1,10 @@
+#define _POSIX_C_SOURCE 200809L        /* for clock_gettime()              */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 #include "gtthread.h"
 
 #ifndef TRUE
@@ -19,6 +22,15 @@ int  count;
 int  count2;
 int  loops = 10;
 int  preemptive = FALSE;
+int  quiet = FALSE;
+
+/*
+ * count of threads done incrementing, kept under its own mutex so that
+ * main() waiting on it doesn't contend for the counters' mutexes
+ */
+gtthread_mutex_t  finished_mp;
+int               finished;
+
 struct incdata
 {
     gtthread_mutex_t      mp;
@@ -26,6 +38,34 @@ struct incdata
     int                   ctr_num;
 };
 
+/*
+ * returns a monotonic timestamp in nanoseconds
+ */
+static long long now_nsec(void)
+{
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long) ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/*
+ * reports the rate at which an operation was performed.  If it was too
+ * quick for the clock to see there is no meaningful rate to print.
+ */
+static void report_rate(char *what, int cnt, long long nsec)
+{
+    if( nsec > 0 )
+    {
+        fprintf(stdout, "%s %d threads in %lld nsec (%.0f/sec)\n", what, cnt, nsec,
+                (double) cnt * 1000000000.0 / nsec);
+    }
+    else
+    {
+        fprintf(stdout, "%s %d threads in %lld nsec (n/a)\n", what, cnt, nsec);
+    }
+}
+
 void *increment(void *pArg)
 {
     struct incdata      * data = (struct incdata *) pArg;
@@ -41,8 +81,11 @@ void *increment(void *pArg)
         assert(rtn != -1);
         
         data->ctr++;
-        fprintf(stdout,"In thread %d, count[%d] = %d\n", id, data->ctr_num, data->ctr);
-        fflush(stdout);
+        if( ! quiet )
+        {
+            fprintf(stdout,"In thread %d, count[%d] = %d\n", id, data->ctr_num, data->ctr);
+            fflush(stdout);
+        }
 
         rtn = gtthread_mutex_unlock(&data->mp);
         assert(rtn != -1);
@@ -59,6 +102,12 @@ void *increment(void *pArg)
             }
         }
     }
+
+    rtn = gtthread_mutex_lock(&finished_mp);
+    assert(rtn != -1);
+    finished++;
+    rtn = gtthread_mutex_unlock(&finished_mp);
+    assert(rtn != -1);
         
     return (void *) (long)id;
 }
@@ -80,8 +129,13 @@ main(int argc, char **argv)
     int                       threads_per = 5;
     void                    * retval;
     int                       rtn;
+    int                       failed = FALSE;
+    long long                 create_start;
+    long long                 create_end;
+    long long                 join_start;
+    long long                 join_end;
 
-    while( (opt=getopt(argc,argv, "hpn:c:t:")) != -1 )
+    while( (opt=getopt(argc,argv, "hpqn:c:t:")) != -1 )
     {
         switch(opt)
         {
@@ -89,6 +143,10 @@ main(int argc, char **argv)
                 preemptive = TRUE;
                 break;
 
+            case 'q':                   /* don't print inside the lock      */
+                quiet = TRUE;
+                break;
+
             case 'n':                   /* number of counters               */
                 cnt = atoi(optarg);
                 if( cnt < 1 )
@@ -131,8 +189,9 @@ main(int argc, char **argv)
                 /* fall through */
 
             case 'h':
-                fprintf(stderr, "Usage:  test_mutex [-p] [-n #] [-c #] [-t #]\n");
+                fprintf(stderr, "Usage:  test_mutex [-p] [-q] [-n #] [-c #] [-t #]\n");
                 fprintf(stderr, "        -p - use pre-emptive switching (vs yielding)\n");
+                fprintf(stderr, "        -q - don't print each increment or thread exit\n");
                 fprintf(stderr, "        -n # - the # of counters to manage (default: 1)\n");
                 fprintf(stderr, "        -c # - the # of iterations to count (default: 10)\n");
                 fprintf(stderr, "        -t # - the # of threads per counter (default: 5)\n");
@@ -145,6 +204,7 @@ main(int argc, char **argv)
      * initialize the threads subsystem
      */
     gtthread_init(1000);
+    gtthread_mutex_init(&finished_mp);
 
     /*
      * allocate and construct the increment data neede for each loop
@@ -162,6 +222,7 @@ main(int argc, char **argv)
      */
     threads = calloc(counters*threads_per, sizeof(*threads));
     assert(threads != NULL);
+    create_start = now_nsec();
     for(j=0; j < threads_per; j++)
     {
         for(i=0; i < counters; i++)
@@ -170,18 +231,65 @@ main(int argc, char **argv)
             assert(rtn != -1);
         }
     }
+    create_end = now_nsec();
 
     if( ! preemptive )
     {
         gtthread_yield();
     }
 
+    /*
+     * wait for all of the threads to finish counting so that the join
+     * timing below covers only the joins and not the increment work
+     */
+    do
+    {
+        rtn = gtthread_mutex_lock(&finished_mp);
+        assert(rtn != -1);
+        cnt = finished;
+        rtn = gtthread_mutex_unlock(&finished_mp);
+        assert(rtn != -1);
+
+        if( cnt < (counters*threads_per) )
+        {
+            gtthread_yield();
+        }
+    } while( cnt < (counters*threads_per) );
+
+    join_start = now_nsec();
     for(i=0; i < (counters*threads_per); i++)
     {
         id = gtthread_id(threads[i]);
         rtn = gtthread_join(threads[i], &retval);
         assert( rtn != -1 );
-        fprintf(stdout, "Thread %d exited with the value %ld\n", id, (long) retval);
+        if( ! quiet )
+        {
+            fprintf(stdout, "Thread %d exited with the value %ld\n", id, (long) retval);
+        }
+    }
+    join_end = now_nsec();
+
+    /*
+     * report the create/join throughput so changes to thread setup and
+     * teardown (e.g. stack allocation) can be measured with large -t values.
+     * Use -q so the join time isn't dominated by the exit messages.  For a
+     * per-thread create+join cost see create_join in gtthread_bench.
+     */
+    report_rate("Created", counters*threads_per, create_end - create_start);
+    report_rate("Joined", counters*threads_per, join_end - join_start);
+
+    /*
+     * make sure no increments were lost -- each counter should have been
+     * bumped once per loop by each of its threads
+     */
+    for(i=0; i < counters; i++)
+    {
+        if( incdatas[i].ctr != (loops * threads_per) )
+        {
+            fprintf(stderr, "count[%d] = %d, expected %d\n", i, incdatas[i].ctr,
+                    loops * threads_per);
+            failed = TRUE;
+        }
     }
 
     /*
@@ -200,5 +308,5 @@ main(int argc, char **argv)
 
 
 
-    return EXIT_SUCCESS;
+    return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }